@@ -1,61 +1,234 @@
 #pragma once
 #include "cstring"
+#include <cstdio>
+#ifdef _WIN32
 #include <windows.h>
+#else
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 #include <assert.h>
 #include <cfloat>
 #include <filesystem>
+#include <climits>
+#include <istream>
+#include <ostream>
+#include <bit>
 #include "Profiler.h"
 
+#if defined(PROFILER_TSC) && (defined(__x86_64__) || defined(_M_X64))
+#define PROFILER_TSC_AVAILABLE
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+#endif
+
+#if defined(PROFILER_DISABLED) && !defined(PROFILER_HOST)
+// Stubs are force inlined so that not even unoptimized builds keep a symbol of them.
+#if defined(_MSC_VER)
+#define PROFILER_STUB __forceinline
+#else
+#define PROFILER_STUB inline __attribute__((always_inline))
+#endif
+PROFILER_STUB void Profiler::Function::AddSample(float sample) {}
+PROFILER_STUB void Profiler::Function::BeginSample() {}
+PROFILER_STUB void Profiler::Function::EndSample() {}
+PROFILER_STUB void Profiler::Function::SetSamplingRate(unsigned int rate, SamplingMode mode) {}
+PROFILER_STUB Profiler::Function* Profiler::FunctionHandle::Get() { return nullptr; }
+PROFILER_STUB Profiler::ScopedFunction::ScopedFunction(const char* name) :function(nullptr) {}
+PROFILER_STUB Profiler::ScopedFunction::ScopedFunction(Function* function) :function(nullptr) {}
+PROFILER_STUB Profiler::ScopedFunction::~ScopedFunction() {}
+PROFILER_STUB void Profiler::SetHightPriority() {}
+PROFILER_STUB void Profiler::SetOverheadCompensation(bool enabled) {}
+PROFILER_STUB double Profiler::GetZoneOverhead() { return 0; }
+PROFILER_STUB void Profiler::Collect() {}
+PROFILER_STUB void Profiler::StartCollector(std::chrono::milliseconds interval) {}
+PROFILER_STUB void Profiler::StopCollector() {}
+PROFILER_STUB void Profiler::BeginFrame() {}
+PROFILER_STUB void Profiler::EndFrame() {}
+PROFILER_STUB Profiler::Function* Profiler::AddFunction(const char* name, Profiler::FunctionType type) { return nullptr; }
+PROFILER_STUB Profiler::Function* Profiler::GetFunction(const char* name) { return nullptr; }
+PROFILER_STUB void Profiler::RemoveFunction(const char* name) {}
+PROFILER_STUB void Profiler::RemoveFunction(Function* function) {}
+PROFILER_STUB Profiler::FunctionRange Profiler::GetFunctions() { return FunctionRange(); }
+PROFILER_STUB Profiler::Function* Profiler::FunctionAt(unsigned int index) { return nullptr; }
+PROFILER_STUB void Profiler::SetCapacity(const Capacity& capacity) {}
+PROFILER_STUB Profiler::Capacity Profiler::GetCapacity() { return Capacity(); }
+PROFILER_STUB void Profiler::BeginFunction(const char* name) {}
+PROFILER_STUB void Profiler::EndFunction(const char* name) {}
+#else
 int GetID()
 {
-    char path[MAX_PATH];
-    GetModuleFileNameA(NULL, path, MAX_PATH);
+    static const int id = []()
+        {
+#ifdef _WIN32
+            char path[MAX_PATH];
+            GetModuleFileNameA(NULL, path, MAX_PATH);
+#else
+            char path[PATH_MAX] = { 0 };
+            readlink("/proc/self/exe", path, PATH_MAX - 1);
+#endif
+
+            int id = 0;
+            int mult = 1;
+            for (int i = 0; path[i] != 0; i++)
+            {
+                id += path[i] * mult;
+                mult *= 32;
+            }
+            return id;
+        }();
+    return id;
+}
+
+#ifdef PROFILER_TSC_AVAILABLE
+bool HasInvariantTSC()
+{
+    unsigned int registers[4] = { 0 };
+#ifdef _MSC_VER
+    __cpuid((int*) registers, 0x80000007);
+#else
+    __get_cpuid(0x80000007, &registers[0], &registers[1], &registers[2], &registers[3]);
+#endif
+    return registers[3] & (1 << 8);
+}
+
+double CalibrateTSC()
+{
+    auto start = std::chrono::steady_clock::now();
+    unsigned long long startTicks = __rdtsc();
+    auto end = start;
+    while (end - start < std::chrono::milliseconds(20))
+        end = std::chrono::steady_clock::now();
+    unsigned long long endTicks = __rdtsc();
+
+    return std::chrono::duration<double, std::milli>(end - start).count() / (endTicks - startTicks);
+}
+
+static const bool useTSC = HasInvariantTSC();
+static const double tscPeriod = useTSC ? CalibrateTSC() : 0.0;
+#endif
+
+long long Now()
+{
+#ifdef PROFILER_TSC_AVAILABLE
+    if (useTSC)
+        return __rdtsc();
+#endif
+    return std::chrono::high_resolution_clock::now().time_since_epoch().count();
+}
+
+double ToMilliseconds(long long ticks)
+{
+#ifdef PROFILER_TSC_AVAILABLE
+    if (useTSC)
+        return ticks * tscPeriod;
+#endif
+    return std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(std::chrono::high_resolution_clock::duration(ticks)).count();
+}
+
+const char* ClockName()
+{
+#ifdef PROFILER_TSC_AVAILABLE
+    if (useTSC)
+        return "TSC";
+#endif
+    return "high_resolution_clock";
+}
+
+Profiler::Samples::Samples() : totalSum(0.0f), totalMin(FLT_MAX), totalMax(-FLT_MAX), offset(0), totalSampleCount(0), sampleCount(0), sampleLimit(0), currentSample(0), estimated(false), owned(false), pooled(false), capacity(0), storage(0) {}
+
+Profiler::Samples::Samples(const Samples& other) :Samples()
+{
+    *this = other;
+}
+
+Profiler::Samples& Profiler::Samples::operator=(const Samples& other)
+{
+    if (this == &other)
+        return *this;
 
-    int id = 0;
-    int mult = 1;
-    for (int i = 0; path[i] != 0; i++)
+    // Samples in a segment keep their own storage, copies on the heap grow to fit.
+    if (!pooled && capacity < other.capacity)
     {
-        id += path[i] * mult;
-        mult *= 32;
+        if (owned) delete[] Storage();
+        capacity = other.capacity;
+        storage = (char*) new float[capacity] - (char*) this;
+        owned = true;
     }
-    return id;
+
+    totalSum = other.totalSum;
+    totalMin = other.totalMin;
+    totalMax = other.totalMax;
+    totalSampleCount = other.totalSampleCount;
+    currentSample = other.currentSample;
+    estimated = other.estimated;
+    sampleCount = std::min(other.sampleCount, capacity);
+    sampleLimit = other.sampleLimit;
+    offset = other.offset < sampleCount ? other.offset : 0;
+    if (sampleCount != 0)
+        memcpy(Storage(), other.Storage(), sampleCount * sizeof(float));
+    return *this;
+}
+
+Profiler::Samples::~Samples()
+{
+    if (owned) delete[] Storage();
 }
 
-Profiler::Samples::Samples() : totalSum(0.0f), totalMin(FLT_MAX), totalMax(-FLT_MAX), offset(0), totalSampleCount(0), sampleCount(0), sampleLimit(maxSampleCount), currentSample(0) {}
+float* Profiler::Samples::Storage() const
+{
+    return (float*) ((const char*) this + storage);
+}
+
+unsigned int Profiler::Samples::Limit() const
+{
+    // Pooled history only grows on the owning side, so the limit can run ahead of the storage.
+    return std::min(sampleLimit, capacity);
+}
 
 std::span<float> Profiler::Samples::Data()
 {
-    unsigned int min = sampleLimit - 1;
+    unsigned int min = Limit() - 1;
     if (sampleCount < min) min = sampleCount;
-    return std::span<float>(&samples[0], &samples[min]);
+    if (Limit() == 0) min = 0;
+    return std::span<float>(Storage(), min);
 }
 
 std::span<const float> Profiler::Samples::Data() const
 {
-    unsigned int min = sampleLimit - 1;
+    unsigned int min = Limit() - 1;
     if (sampleCount < min) min = sampleCount;
-    return std::span<const float>(&samples[0], &samples[min]);
+    if (Limit() == 0) min = 0;
+    return std::span<const float>(Storage(), min);
 }
 
 int Profiler::Samples::GetOffset() const { return offset; }
 
 float Profiler::Samples::GetMax() const
 {
-    float m = samples[0];
+    float m = Storage()[0];
     for (auto&& s : Data()) if (s > m)m = s;
     return m;
 }
 
 float Profiler::Samples::GetMin() const
 {
-    float m = samples[0];
+    float m = Storage()[0];
     for (auto&& s : Data()) if (s < m)m = s;
     return m;
 }
 
 float Profiler::Samples::GetAverage() const
 {
-    float m = samples[0];
+    float m = Storage()[0];
     for (auto&& s : Data()) m += s;
     return m / Data().size();
 }
@@ -70,20 +243,25 @@ unsigned int Profiler::Samples::GetTotalSampleCount() const { return totalSample
 
 float Profiler::Samples::GetCurrent() const
 {
-    if (sampleCount < sampleLimit)
+    if (sampleCount == 0)
+        return 0.0f;
+    if (sampleCount < Limit())
     {
         int index = sampleCount - 1;
         if (0 > index) index = 0;
-        return samples[index];
+        return Storage()[index];
     }
-    return samples[offset];
+    return Storage()[(offset + Limit() - 1) % Limit()];
 }
 
+bool Profiler::Samples::IsEstimated() const { return estimated; }
+
+unsigned int Profiler::Samples::GetCapacity() const { return capacity; }
+
 unsigned int& Profiler::Samples::GetSampleLimit() { return sampleLimit; }
 
 void Profiler::Samples::SetSampleLimit(unsigned int sampleLimit)
 {
-    assert(sampleLimit <= maxSampleCount);
     this->sampleLimit = sampleLimit;
     if (sampleLimit < sampleCount)
     {
@@ -98,6 +276,7 @@ void Profiler::Samples::UnwindOffset()
 {
     int count = sampleCount;
     int offs = offset;
+    float* samples = Storage();
     float* temp = new float[count - offs];
     memcpy(temp, &samples[offs], (count - offs) * sizeof(samples[0]));
     memcpy(&samples[count - offs], &samples[0], offs * sizeof(samples[0]));
@@ -107,6 +286,55 @@ void Profiler::Samples::UnwindOffset()
     offset = 0;
 }
 
+template<typename T>
+void WriteValue(std::ostream& file, const T& value)
+{
+    file.write((const char*) &value, sizeof(value));
+}
+
+template<typename T>
+void ReadValue(std::istream& file, T& value)
+{
+    file.read((char*) &value, sizeof(value));
+}
+
+void Profiler::Samples::Write(std::ostream& file) const
+{
+    WriteValue(file, totalSum);
+    WriteValue(file, totalMin);
+    WriteValue(file, totalMax);
+    WriteValue(file, totalSampleCount);
+    WriteValue(file, currentSample);
+    WriteValue(file, estimated);
+    WriteValue(file, sampleCount);
+    // Oldest sample first, so a reader does not need the offset.
+    file.write((const char*) &Storage()[offset], (sampleCount - offset) * sizeof(float));
+    file.write((const char*) Storage(), offset * sizeof(float));
+}
+
+void Profiler::Samples::Read(std::istream& file)
+{
+    // Loaded samples always live on the heap of this process.
+    assert(!pooled);
+    ReadValue(file, totalSum);
+    ReadValue(file, totalMin);
+    ReadValue(file, totalMax);
+    ReadValue(file, totalSampleCount);
+    ReadValue(file, currentSample);
+    ReadValue(file, estimated);
+    ReadValue(file, sampleCount);
+    if (!file)
+        sampleCount = 0;
+
+    if (owned) delete[] Storage();
+    capacity = sampleCount + 1;
+    sampleLimit = capacity;
+    offset = 0;
+    storage = (char*) new float[capacity] - (char*) this;
+    owned = true;
+    file.read((char*) Storage(), sampleCount * sizeof(float));
+}
+
 void Profiler::Samples::BeginAccumulate()
 {
     currentSample = 0;
@@ -120,24 +348,28 @@ void Profiler::Samples::Accumulate(float sample)
 void Profiler::Samples::EndAccumulate()
 {
     float sample = currentSample;
+    float* samples = Storage();
 
     totalSampleCount++;
     totalSum += sample;
     if (sample > totalMax) totalMax = sample;
     if (sample < totalMin) totalMin = sample;
 
-    if (sampleCount < sampleLimit)
+    unsigned int limit = Limit();
+    if (limit == 0)
+        return;
+    if (sampleCount < limit)
         samples[sampleCount++] = sample;
     else
     {
         samples[offset] = sample;
-        offset = (offset + 1) % sampleLimit;
+        offset = (offset + 1) % limit;
     }
 }
 
 
 Profiler::Function::Function(const char* name, Profiler::FunctionType type)
-    :name{ 0 }, type(type), programID(GetID())
+    :name{ 0 }, type(type), id(HashName(name)), line(0), index(0), programID(GetID()), parent(-1), invocations(0), lastInvocations(0), samplingRate(1), samplingMode(EveryNth), estimated(false)
 {
     strncpy(this->name, name, maxFunctionNameLength);
 }
@@ -147,48 +379,106 @@ const char* Profiler::Function::GetName() const { return name; }
 
 Profiler::FunctionType Profiler::Function::GetType() const { return type; }
 
+unsigned int Profiler::Function::GetIndex() const { return index; }
+
+unsigned int Profiler::Function::GetLine() const { return line; }
+
 int Profiler::Function::GetInvocations() const { return lastInvocations; }
 
 Profiler::Samples& Profiler::Function::GetSamples() { return samples; }
 const Profiler::Samples& Profiler::Function::GetSamples() const { return samples; }
 
-void Profiler::Function::AddSample(float sample)
+Profiler::Samples& Profiler::Function::GetSelfSamples() { return selfSamples; }
+const Profiler::Samples& Profiler::Function::GetSelfSamples() const { return selfSamples; }
+
+Profiler::Function* Profiler::Function::GetParent()
 {
-    if (!isFrameActive)
-        samples.BeginAccumulate();
+    if (parent < 0 || parent >= headerHandle.header->functionCount)
+        return nullptr;
+    return FunctionAt(parent);
+}
+
+unsigned int Profiler::Function::GetSamplingRate() const { return samplingRate; }
+
+Profiler::SamplingMode Profiler::Function::GetSamplingMode() const { return samplingMode; }
+
+void Profiler::Function::SetSamplingRate(unsigned int rate, SamplingMode mode)
+{
+    samplingRate = rate < 1 ? 1 : rate;
+    samplingMode = mode;
+}
+
+void Profiler::Function::Write(std::ostream& file) const
+{
+    WriteValue(file, type);
+    WriteValue(file, name);
+    WriteValue(file, lastInvocations);
+    WriteValue(file, samplingRate);
+    WriteValue(file, samplingMode);
+    samples.Write(file);
+    selfSamples.Write(file);
+}
 
-    invocations++;
-    samples.Accumulate(sample);
+void Profiler::Function::Read(std::istream& file)
+{
+    ReadValue(file, type);
+    ReadValue(file, name);
+    ReadValue(file, lastInvocations);
+    ReadValue(file, samplingRate);
+    ReadValue(file, samplingMode);
+    samples.Read(file);
+    selfSamples.Read(file);
+}
 
-    if (!isFrameActive)
+void Profiler::Function::EndAccumulate()
+{
+    lastInvocations = invocations;
+    invocations = 0;
+    samples.estimated = estimated;
+    selfSamples.estimated = estimated;
+    estimated = false;
+    if (samples.pooled)
     {
-        lastInvocations = invocations;
-        invocations = 0;
-        samples.EndAccumulate();
+        Reserve(*this, samples);
+        Reserve(*this, selfSamples);
     }
+    samples.EndAccumulate();
+    samples.BeginAccumulate();
+    selfSamples.EndAccumulate();
+    selfSamples.BeginAccumulate();
+}
+
+void Profiler::Function::AddSample(float sample)
+{
+    Event event{ index, SampleEvent };
+    event.value = sample;
+    Record(event);
+
+    if (!hasFrames.load(std::memory_order_relaxed))
+        Publish(event.function);
 }
 
 void Profiler::Function::BeginSample()
 {
-    if (!isFrameActive)
-        samples.BeginAccumulate();
+    ThreadState* thread = GetThreadState();
+    if (!thread)return;
 
-    invocations++;
-    sampleStart = std::chrono::high_resolution_clock::now();
+    if (!BeginTiming(*thread, *this))
+        return;
+    Record({ index, BeginEvent, Now() });
 }
 
 void Profiler::Function::EndSample()
 {
-    auto sampleEnd = std::chrono::high_resolution_clock::now();
-    float sample = std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(sampleEnd - sampleStart).count();
-    samples.Accumulate(sample);
+    ThreadState* thread = GetThreadState();
+    if (!thread)return;
 
-    if (!isFrameActive)
-    {
-        lastInvocations = invocations;
-        invocations = 0;
-        samples.EndAccumulate();
-    }
+    if (!EndTiming(*thread, index))
+        return;
+    Record({ index, EndEvent, Now() });
+
+    if (!hasFrames.load(std::memory_order_relaxed))
+        Publish(index);
 }
 
 
@@ -201,6 +491,18 @@ bool Profiler::Function::operator <(const Profiler::Function& rhs) const
 }
 
 
+Profiler::Function* Profiler::FunctionHandle::Get()
+{
+    if (function && generation == headerHandle.header->generation)
+        return function;
+
+    function = AddFunction(name, id, line);
+    if (function)
+        generation = headerHandle.header->generation;
+    return function;
+}
+
+
 Profiler::ScopedFunction::ScopedFunction(const char* name)
 {
     function = AddFunction(name);
@@ -208,6 +510,12 @@ Profiler::ScopedFunction::ScopedFunction(const char* name)
     function->BeginSample();
 }
 
+Profiler::ScopedFunction::ScopedFunction(Function* function) :function(function)
+{
+    if (!function)return;
+    function->BeginSample();
+}
+
 Profiler::ScopedFunction::~ScopedFunction()
 {
     if (!function)return;
@@ -217,39 +525,421 @@ Profiler::ScopedFunction::~ScopedFunction()
 
 void Profiler::SetHightPriority()
 {
+#ifdef _WIN32
     SetPriorityClass(GetCurrentProcess(), REALTIME_PRIORITY_CLASS);
+#else
+    setpriority(PRIO_PROCESS, 0, -20);
+#endif
 }
 
-void Profiler::BeginFrame()
+Profiler::EventRing::EventRing() :claimed(false), programID(0), head(0), cachedTail(0), tail(0) {}
+
+bool Profiler::EventRing::Push(const Event& event)
+{
+    unsigned int position = head.load(std::memory_order_relaxed);
+    if (position - cachedTail == eventRingSize)
+    {
+        cachedTail = tail.load(std::memory_order_acquire);
+        if (position - cachedTail == eventRingSize)
+            return false;
+    }
+
+    events[position % eventRingSize] = event;
+    head.store(position + 1, std::memory_order_release);
+    return true;
+}
+
+unsigned int Profiler::EventRing::Pop(std::span<Event> batch)
+{
+    unsigned int position = tail.load(std::memory_order_relaxed);
+    unsigned int count = head.load(std::memory_order_acquire) - position;
+    if (count > batch.size()) count = batch.size();
+
+    for (unsigned int i = 0; i < count; i++)
+        batch[i] = events[(position + i) % eventRingSize];
+    tail.store(position + count, std::memory_order_release);
+    return count;
+}
+
+template<typename T>
+void Increase(std::atomic<T>& value, T amount)
+{
+    value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+Profiler::ZoneTotals Profiler::ZoneAccumulator::Load() const
+{
+    return {
+        invocations.load(std::memory_order_relaxed),
+        untimed.load(std::memory_order_relaxed),
+        time.load(std::memory_order_relaxed),
+        selfTime.load(std::memory_order_relaxed),
+        value.load(std::memory_order_relaxed)
+    };
+}
+
+Profiler::ThreadHandle::~ThreadHandle()
+{
+    if (index < 0)return;
+    Collect();
+    {
+        std::lock_guard lock(collectorMutex);
+        Merge(threadStates[index]);
+    }
+    headerHandle.header->rings[index].claimed.store(false, std::memory_order_release);
+}
+
+Profiler::ThreadState* Profiler::GetThreadState()
 {
-    isFrameActive = true;
+    if (threadHandle.index >= 0)
+        return &threadStates[threadHandle.index];
+
+    if (!InitHeader())
+        return nullptr;
+
+    for (unsigned int i = 0; i < maxThreads; i++)
+    {
+        EventRing& ring = headerHandle.header->rings[i];
+        bool claimed = false;
+        if (!ring.claimed.compare_exchange_strong(claimed, true, std::memory_order_acquire))
+            continue;
+
+        ThreadState& thread = threadStates[i];
+        {
+            std::lock_guard lock(collectorMutex);
+            ring.programID = GetID();
+            ring.cachedTail = ring.tail.load(std::memory_order_relaxed);
+
+            thread.open.clear();
+            unsigned int functions = headerHandle.header->capacity.functions;
+            thread.depths.assign(functions, 0);
+            thread.sampling.assign(functions, 0);
+            thread.skipped.assign(functions, 0);
+            thread.random = 2654435761u * (i + 1);
+            if (!thread.accumulators)
+            {
+                thread.generation = headerHandle.header->generation;
+                thread.accumulators = std::make_unique<ZoneAccumulator[]>(functions);
+                thread.merged = std::make_unique<ZoneTotals[]>(functions);
+            }
+            threadHandle.index = i;
+        }
+        std::call_once(calibrationFlag, Calibrate);
+        return &thread;
+    }
+    return nullptr;
+}
+
+void Profiler::Calibrate()
+{
+    static const int rounds = 20;
+    static const int zonesPerRound = eventRingSize / 4;
+
+    Function* overhead = AddFunction("Profiler Overhead");
+    if (!overhead)return;
+    unsigned int function = overhead->index;
+    ThreadState& thread = threadStates[threadHandle.index];
+    ZoneAccumulator& accumulator = thread.accumulators[function];
+
+    long long bestZone = LLONG_MAX;
+    long long bestMeasured = LLONG_MAX;
+    for (int round = 0; round < rounds; round++)
+    {
+        Collect();
+        long long measured = accumulator.time.load(std::memory_order_relaxed);
+        long long start = Now();
+        for (int i = 0; i < zonesPerRound; i++)
+        {
+            Record({ function, BeginEvent, Now() });
+            Record({ function, EndEvent, Now() });
+        }
+        long long end = Now();
+        Collect();
+
+        measured = accumulator.time.load(std::memory_order_relaxed) - measured;
+        bestZone = std::min(bestZone, (end - start) / zonesPerRound);
+        bestMeasured = std::min(bestMeasured, measured / zonesPerRound);
+    }
+
+    zoneOverhead = bestZone;
+    measuredOverhead = std::min(bestMeasured, bestZone);
+
+    std::lock_guard lock(collectorMutex);
+    thread.merged[function] = accumulator.Load();
+}
+
+bool Profiler::BeginTiming(ThreadState& thread, Function& function)
+{
+    // Nested invocations follow the decision of the outermost one, positive depth is timed and negative skipped.
+    unsigned int index = function.index;
+    int& depth = thread.sampling[index];
+    if (depth == 0)
+    {
+        bool timed = true;
+        if (function.samplingRate > 1 && function.samplingMode == Random)
+        {
+            thread.random ^= thread.random << 13;
+            thread.random ^= thread.random >> 17;
+            thread.random ^= thread.random << 5;
+            timed = thread.random % function.samplingRate == 0;
+        }
+        else if (function.samplingRate > 1)
+        {
+            timed = thread.skipped[index] == 0;
+            thread.skipped[index] = (thread.skipped[index] + 1) % function.samplingRate;
+        }
+        depth = timed ? 1 : -1;
+    }
+    else
+        depth += depth > 0 ? 1 : -1;
+
+    if (depth > 0)
+        return true;
+    Increase(thread.accumulators[index].untimed, 1u);
+    return false;
+}
+
+bool Profiler::EndTiming(ThreadState& thread, unsigned int index)
+{
+    int& depth = thread.sampling[index];
+    if (depth < 0)
+    {
+        depth++;
+        return false;
+    }
+    if (depth > 0)
+        depth--;
+    return true;
+}
+
+void Profiler::SetOverheadCompensation(bool enabled)
+{
+    compensateOverhead.store(enabled, std::memory_order_relaxed);
+}
+
+double Profiler::GetZoneOverhead()
+{
+    return ToMilliseconds(zoneOverhead);
+}
+
+void Profiler::Record(const Event& event)
+{
+    ThreadState* thread = GetThreadState();
+    if (!thread)return;
+
+#ifdef PROFILER_DEFERRED
+    // A full ring is drained by its own thread, the only case where an instrumented thread waits on the collector.
+    while (!headerHandle.header->rings[threadHandle.index].Push(event))
+        Collect();
+#else
+    Aggregate(*thread, event);
+#endif
+}
+
+void Profiler::Aggregate(ThreadState& thread, const Event& event)
+{
+    if (event.function >= (unsigned int) headerHandle.header->functionCount)
+        return;
+
+    ZoneAccumulator& accumulator = thread.accumulators[event.function];
+    std::vector<OpenZone>& open = thread.open;
+    switch (event.type)
+    {
+    case BeginEvent:
+        open.push_back({ event, 0, 0, 0 });
+        thread.depths[event.function]++;
+        return;
+    case EndEvent:
+    {
+        auto zone = open.rbegin();
+        while (zone != open.rend() && zone->begin.function != event.function) zone++;
+        if (zone == open.rend())
+            return;
+
+        long long duration = event.time - zone->begin.time;
+        long long self = std::max(0ll, duration - zone->childTime);
+
+        // A timed invocation of a sampled zone stands in for samplingRate invocations, skipped ones included.
+        long long weight = std::max(1u, FunctionAt(event.function)->samplingRate);
+        auto position = std::next(zone).base();
+        if (position != open.begin())
+        {
+            std::prev(position)->childTime += thread.depths[event.function] == 1 ? duration * weight : duration;
+            std::prev(position)->children++;
+            std::prev(position)->descendants += zone->descendants + 1;
+        }
+
+        // Every zone pays measuredOverhead inside its own interval, the rest of zoneOverhead lands in its parent.
+        if (compensateOverhead.load(std::memory_order_relaxed))
+        {
+            duration = std::max(0ll, duration - measuredOverhead - zoneOverhead * zone->descendants);
+            self = std::max(0ll, self - measuredOverhead - (zoneOverhead - measuredOverhead) * zone->children);
+        }
+        Increase(accumulator.selfTime, self * weight);
+
+        // Inner invocations of a recursive or overlapping zone are already covered by the outermost one.
+        if (--thread.depths[event.function] == 0)
+        {
+            Increase(accumulator.time, duration * weight);
+            accumulator.parent.store(position != open.begin() ? std::prev(position)->begin.function : -1, std::memory_order_relaxed);
+        }
+        open.erase(position);
+        break;
+    }
+    case SampleEvent:
+        Increase(accumulator.value, (double) event.value);
+        break;
+    }
+    Increase(accumulator.invocations, 1u);
+}
+
+void Profiler::Merge(ThreadState& thread, unsigned int index)
+{
+    Function& function = *FunctionAt(index);
+    ZoneAccumulator& accumulator = thread.accumulators[index];
+    ZoneTotals& merged = thread.merged[index];
+    ZoneTotals current = accumulator.Load();
+    if (current.invocations == merged.invocations && current.untimed == merged.untimed)
+        return;
+
+    if (function.type == Time)
+        mergedZones += current.invocations - merged.invocations;
+    if (current.untimed != merged.untimed)
+        function.estimated = true;
+    function.parent = accumulator.parent.load(std::memory_order_relaxed);
+    function.invocations += current.invocations - merged.invocations + current.untimed - merged.untimed;
+    function.samples.Accumulate(ToMilliseconds(current.time - merged.time) + (current.value - merged.value));
+    function.selfSamples.Accumulate(ToMilliseconds(current.selfTime - merged.selfTime));
+    merged = current;
+}
+
+void Profiler::Merge(ThreadState& thread)
+{
+    if (!thread.accumulators)
+        return;
+
+    // Removing a function moves slots around, deltas recorded against the old layout are dropped.
+    if (thread.generation != headerHandle.header->generation)
+    {
+        for (unsigned int i = 0; i < headerHandle.header->capacity.functions; i++)
+            thread.merged[i] = thread.accumulators[i].Load();
+        thread.generation = headerHandle.header->generation;
+        return;
+    }
+
+    for (int i = 0; i < headerHandle.header->functionCount; i++)
+        Merge(thread, i);
+}
+
+void Profiler::Publish(unsigned int index)
+{
+    ThreadState* thread = GetThreadState();
+    if (!thread)return;
+
+    Collect();
+    std::lock_guard lock(collectorMutex);
+    if (index >= (unsigned int) headerHandle.header->functionCount || thread->generation != headerHandle.header->generation)
+        return;
+
+    Merge(*thread, index);
+    FunctionAt(index)->EndAccumulate();
+}
+
+void Profiler::Collect()
+{
+    if (!InitHeader())
+        return;
+
+    std::lock_guard lock(collectorMutex);
     int id = GetID();
-    for (auto&& i : GetFunctions())
-        if (i.programID == id)
-            i.GetSamples().BeginAccumulate();
+    Event batch[256];
+    for (unsigned int i = 0; i < maxThreads; i++)
+    {
+        EventRing& ring = headerHandle.header->rings[i];
+        if (!ring.claimed.load(std::memory_order_acquire) || ring.programID != id)
+            continue;
+
+        while (unsigned int count = ring.Pop(batch))
+            for (auto&& event : std::span<Event>(batch, count))
+                Aggregate(threadStates[i], event);
+    }
+}
+
+void Profiler::StartCollector(std::chrono::milliseconds interval)
+{
+    collector = std::jthread([interval](std::stop_token stop)
+        {
+            while (!stop.stop_requested())
+            {
+                Collect();
+                std::this_thread::sleep_for(interval);
+            }
+        });
+}
+
+void Profiler::StopCollector()
+{
+    collector = std::jthread();
+}
+
+void Profiler::BeginFrame()
+{
+    hasFrames.store(true, std::memory_order_relaxed);
 }
 void Profiler::EndFrame()
 {
-    isFrameActive = false;
+    Collect();
+
+    std::lock_guard lock(collectorMutex);
+    mergedZones = 0;
+    for (auto&& thread : threadStates)
+        Merge(thread);
+
+    if (Function* overhead = GetFunction("Profiler Overhead"))
+    {
+        overhead->invocations += mergedZones;
+        overhead->samples.Accumulate(ToMilliseconds(zoneOverhead * mergedZones));
+    }
+
+    int id = GetID();
     for (auto&& i : GetFunctions())
-        if (i.programID == GetID())
-        {
-            i.lastInvocations = i.invocations;
-            i.invocations = 0;
-            i.GetSamples().EndAccumulate();
-        }
+        if (i.programID == id)
+            i.EndAccumulate();
 }
 
 Profiler::Function* Profiler::AddFunction(const char* name, Profiler::FunctionType type)
+{
+    return AddFunction(name, HashName(name), 0, type);
+}
+
+Profiler::Function* Profiler::AddFunction(const char* name, unsigned long long id, unsigned int line, Profiler::FunctionType type)
 {
     if (!Profiler::InitHeader())
         return nullptr;
 
-    if (Profiler::Function* function = Profiler::GetFunction(name))
-        return function;
+    std::lock_guard lock(registryMutex);
+    Header* header = Profiler::headerHandle.header;
+    int& entry = FindIndexEntry(id);
+    if (entry != 0)
+        return FunctionAt(entry - 1);
+
+    unsigned int index = header->functionCount;
+    Function* slot = index < header->capacity.functions ? FunctionAt(index) : nullptr;
+    if (!slot)
+        return nullptr;
 
-    assert(Profiler::headerHandle.header->functionCount < Profiler::maxFunctions);
-    return new (&Profiler::headerHandle.header->functions[Profiler::headerHandle.header->functionCount++]) Profiler::Function(name, type);
+    // Sample history is taken from the pool of the segment once the zone records its first frame.
+    Function* function = new (slot) Profiler::Function(name, type);
+    function->id = id;
+    function->line = line;
+    function->index = index;
+    function->samples.pooled = true;
+    function->samples.sampleLimit = header->capacity.samples;
+    function->selfSamples.pooled = true;
+    function->selfSamples.sampleLimit = header->capacity.samples;
+    entry = index + 1;
+    header->functionCount++;
+    return function;
 }
 
 Profiler::Function* Profiler::GetFunction(const char* name)
@@ -257,35 +947,224 @@ Profiler::Function* Profiler::GetFunction(const char* name)
     if (!Profiler::InitHeader() || name[0] == 0)
         return nullptr;
 
-    for (auto&& func : GetFunctions())
-        if (strcmp(name, func.name) == 0)
-            return &func;
+    int entry = FindIndexEntry(HashName(name));
+    if (entry == 0)
+        return nullptr;
 
-    return nullptr;
+    return FunctionAt(entry - 1);
 }
 
 void Profiler::RemoveFunction(const char* name)
 {
-    if (!Profiler::InitHeader() || name[0] == 0)
+    RemoveFunction(GetFunction(name));
+}
+
+void Profiler::RemoveFunction(Function* function)
+{
+    if (!function)
         return;
 
-    for (auto&& func : GetFunctions())
+    Header* header = Profiler::headerHandle.header;
+    int& entry = FindIndexEntry(function->id);
+    if (entry == 0)
+        return;
+
+    int slot = entry - 1;
+    int last = header->functionCount - 1;
+    EraseIndexEntry(&entry - header->FunctionIndex());
+    Function& removed = *FunctionAt(slot);
+    Resize(removed, removed.samples, 0);
+    Resize(removed, removed.selfSamples, 0);
+    if (slot != last)
     {
-        if (strcmp(name, func.name) == 0)
-        {
-            std::swap(func, GetFunctions().back());
-            Profiler::headerHandle.header->functionCount--;
-            return;
-        }
+        // The last function moves into the freed slot, its samples are copied into blocks from the pool of that slot.
+        Function& moved = *FunctionAt(last);
+        FindIndexEntry(moved.id) = slot + 1;
+        Resize(removed, removed.samples, moved.samples.capacity);
+        Resize(removed, removed.selfSamples, moved.selfSamples.capacity);
+        removed = moved;
+        removed.index = slot;
+        Resize(moved, moved.samples, 0);
+        Resize(moved, moved.selfSamples, 0);
     }
+    for (auto&& func : FunctionRange(last))
+    {
+        if (func.parent == slot)
+            func.parent = -1;
+        else if (func.parent == last)
+            func.parent = slot;
+    }
+    header->functionCount--;
+    header->generation++;
 }
 
-std::span<Profiler::Function> Profiler::GetFunctions()
+Profiler::FunctionRange Profiler::GetFunctions()
 {
     if (!Profiler::InitHeader())
-        return std::span<Profiler::Function>();
+        return FunctionRange();
+
+    return FunctionRange(Profiler::headerHandle.header->functionCount);
+}
+
+void Profiler::SetCapacity(const Capacity& capacity)
+{
+    Profiler::capacity.functions = std::max(1u, capacity.functions);
+    Profiler::capacity.segmentFunctions = std::max(1u, capacity.segmentFunctions);
+    Profiler::capacity.samples = std::max(2u, capacity.samples);
+    Profiler::capacity.segmentSamples = capacity.segmentSamples;
+}
+
+Profiler::Capacity Profiler::GetCapacity()
+{
+    if (!InitHeader())
+        return capacity;
+    return headerHandle.header->capacity;
+}
+
+Profiler::Function* Profiler::FunctionAt(unsigned int index)
+{
+    unsigned int segmentFunctions = headerHandle.header->capacity.segmentFunctions;
+    SegmentHandle& segment = headerHandle.segments[index / segmentFunctions];
+    Function* functions = segment.functions.load(std::memory_order_acquire);
+    if (!functions)
+    {
+        // Segments are created by whichever process first puts a zone in them, the others map them on first access.
+        std::lock_guard lock(segmentMutex);
+        if (!segment.Map(index / segmentFunctions, SegmentSize(headerHandle.header->capacity)))
+            return nullptr;
+        functions = segment.functions.load(std::memory_order_relaxed);
+    }
+    return &functions[index % segmentFunctions];
+}
+
+size_t Profiler::SegmentSize(const Capacity& capacity)
+{
+    return capacity.segmentFunctions * sizeof(Function) + sizeof(Pool) + capacity.segmentSamples * sizeof(float);
+}
+
+unsigned int BlockSize(unsigned int samples)
+{
+    return std::bit_ceil(std::max(16u, samples));
+}
+
+Profiler::Pool& Profiler::PoolOf(Function& function)
+{
+    unsigned int segmentFunctions = headerHandle.header->capacity.segmentFunctions;
+    return *(Pool*) (&function - function.index % segmentFunctions + segmentFunctions);
+}
+
+float* Profiler::Allocate(Pool& pool, unsigned int size)
+{
+    // The pool is shared by every process with zones in the segment, so it is guarded by a lock living in it.
+    unsigned int& freeBlock = pool.freeBlocks[std::bit_width(size) - 1];
+    while (pool.locked.exchange(true, std::memory_order_acquire))
+        std::this_thread::yield();
+
+    unsigned int block = freeBlock;
+    if (block != 0)
+        freeBlock = *(unsigned int*) &pool.Data()[block - 1];
+    else if (pool.used + size <= headerHandle.header->capacity.segmentSamples)
+    {
+        block = pool.used + 1;
+        pool.used += size;
+    }
+    pool.locked.store(false, std::memory_order_release);
+    return block != 0 ? &pool.Data()[block - 1] : nullptr;
+}
+
+void Profiler::Free(Pool& pool, float* block, unsigned int size)
+{
+    unsigned int& freeBlock = pool.freeBlocks[std::bit_width(size) - 1];
+    while (pool.locked.exchange(true, std::memory_order_acquire))
+        std::this_thread::yield();
+
+    *(unsigned int*) block = freeBlock;
+    freeBlock = block - pool.Data() + 1;
+    pool.locked.store(false, std::memory_order_release);
+}
+
+bool Profiler::Resize(Function& function, Samples& samples, unsigned int size)
+{
+    Pool& pool = PoolOf(function);
+    float* block = size != 0 ? Allocate(pool, size) : nullptr;
+    if (size != 0 && !block)
+        return false;
+
+    // The newest samples are kept, oldest first.
+    float* data = samples.Storage();
+    unsigned int count = std::min(samples.sampleCount, size);
+    if (count != 0)
+    {
+        unsigned int start = (samples.offset + samples.sampleCount - count) % samples.sampleCount;
+        unsigned int first = std::min(count, samples.sampleCount - start);
+        memcpy(block, &data[start], first * sizeof(float));
+        memcpy(block + first, data, (count - first) * sizeof(float));
+    }
+    if (samples.capacity != 0)
+        Free(pool, data, samples.capacity);
+
+    samples.storage = block ? (char*) block - (char*) &samples : 0;
+    samples.capacity = size;
+    samples.sampleCount = count;
+    samples.offset = 0;
+    return true;
+}
+
+void Profiler::Reserve(Function& function, Samples& samples)
+{
+    // History doubles as it fills, up to the limit, and shrinks back when the limit is lowered.
+    samples.sampleLimit = std::min(samples.sampleLimit, headerHandle.header->capacity.samples);
+    unsigned int needed = std::min(samples.sampleCount + 1, samples.sampleLimit);
+    unsigned int size = needed != 0 ? BlockSize(needed) : 0;
+    if (size == samples.capacity)
+        return;
+
+    // With the pool exhausted the zone keeps wrapping around the history it already has.
+    if (!Resize(function, samples, size))
+        samples.sampleLimit = samples.capacity;
+}
+
+int& Profiler::FindIndexEntry(unsigned long long id)
+{
+    // Zones are identified by their 64 bit id alone, names are never compared.
+    Header* header = Profiler::headerHandle.header;
+    int* functionIndex = header->FunctionIndex();
+    unsigned int mask = header->indexSize - 1;
+    unsigned int position = id & mask;
+    while (functionIndex[position] != 0)
+    {
+        if (FunctionAt(functionIndex[position] - 1)->id == id)
+            break;
+        position = (position + 1) & mask;
+    }
+    return functionIndex[position];
+}
 
-    return std::span<Profiler::Function>(&Profiler::headerHandle.header->functions[0], &Profiler::headerHandle.header->functions[Profiler::headerHandle.header->functionCount]);
+void Profiler::EraseIndexEntry(int position)
+{
+    // Backward shift deletion, keeps every probe sequence free of holes without tombstones.
+    Header* header = Profiler::headerHandle.header;
+    int* functionIndex = header->FunctionIndex();
+    unsigned int mask = header->indexSize - 1;
+    unsigned int hole = position;
+    unsigned int next = hole;
+    while (true)
+    {
+        functionIndex[hole] = 0;
+        while (true)
+        {
+            next = (next + 1) & mask;
+            if (functionIndex[next] == 0)
+                return;
+
+            unsigned int home = FunctionAt(functionIndex[next] - 1)->id & mask;
+            bool inPlace = hole <= next ? (hole < home && home <= next) : (hole < home || home <= next);
+            if (!inPlace)
+                break;
+        }
+        functionIndex[hole] = functionIndex[next];
+        hole = next;
+    }
 }
 
 void Profiler::BeginFunction(const char* name)
@@ -303,11 +1182,37 @@ void Profiler::EndFunction(const char* name)
 }
 
 
+unsigned int IndexSize(const Profiler::Capacity& capacity)
+{
+    unsigned int indexSize = 1;
+    while (indexSize < 2 * capacity.functions) indexSize *= 2;
+    return indexSize;
+}
+
+unsigned int SegmentCount(const Profiler::Capacity& capacity)
+{
+    return (capacity.functions + capacity.segmentFunctions - 1) / capacity.segmentFunctions;
+}
+
+#ifdef _WIN32
 bool Profiler::HeaderHandle::Create()
 {
-    fileHandle = (void*) CreateFileMappingA((HANDLE) -1, NULL, PAGE_READWRITE, 0, sizeof(Profiler::Header), "Profiler/Header");
-    header = (Profiler::Header*) (LPTSTR) MapViewOfFile(fileHandle, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(Profiler::Header));
-    header->functionCount = 0;
+    unsigned int indexSize = IndexSize(Profiler::capacity);
+    size_t size = sizeof(Profiler::Header) + indexSize * sizeof(int);
+    fileHandle = (void*) CreateFileMappingA((HANDLE) -1, NULL, PAGE_READWRITE, 0, size, "Profiler/Header");
+    Header* created = (Profiler::Header*) (LPTSTR) MapViewOfFile(fileHandle, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (!created)
+        return false;
+
+    created->functionCount = 0;
+    created->generation++;
+    created->capacity = Profiler::capacity;
+    created->indexSize = indexSize;
+    memset(created->FunctionIndex(), 0, indexSize * sizeof(int));
+    for (auto&& ring : created->rings)
+        new (&ring) EventRing();
+    segments = std::make_unique<SegmentHandle[]>(SegmentCount(created->capacity));
+    header = created;
 
     return fileHandle;
 }
@@ -315,16 +1220,191 @@ bool Profiler::HeaderHandle::Create()
 bool Profiler::HeaderHandle::Open()
 {
     fileHandle = (void*) OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, "Profiler/Header");
-    header = (Profiler::Header*) (LPTSTR) MapViewOfFile(fileHandle, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(Profiler::Header));
+    Header* opened = (Profiler::Header*) (LPTSTR) MapViewOfFile(fileHandle, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+    if (!opened || opened->capacity.segmentFunctions == 0)
+        return false;
 
+    segments = std::make_unique<SegmentHandle[]>(SegmentCount(opened->capacity));
+    header = opened;
     return fileHandle;
 }
 
 Profiler::HeaderHandle::~HeaderHandle()
 {
+    segments.reset();
     UnmapViewOfFile(header);
     CloseHandle(fileHandle);
 }
 
+Profiler::SegmentHandle::SegmentHandle() :fileHandle(nullptr), functions(nullptr) {}
+
+bool Profiler::SegmentHandle::Map(unsigned int index, size_t size)
+{
+    if (functions.load(std::memory_order_relaxed))
+        return true;
+
+    char name[64];
+    snprintf(name, sizeof(name), "Profiler/Segment.%u", index);
+    if (!fileHandle)
+        fileHandle = (void*) CreateFileMappingA((HANDLE) -1, NULL, PAGE_READWRITE, (DWORD) ((unsigned long long) size >> 32), (DWORD) size, name);
+    if (!fileHandle)
+        return false;
+
+    void* view = MapViewOfFile(fileHandle, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (!view)
+        return false;
+
+    functions.store((Function*) view, std::memory_order_release);
+    return true;
+}
+
+Profiler::SegmentHandle::~SegmentHandle()
+{
+    if (functions)
+        UnmapViewOfFile(functions);
+    if (fileHandle)
+        CloseHandle(fileHandle);
+}
+#else
+bool Profiler::HeaderHandle::Create()
+{
+    fileHandle = shm_open("/Profiler.Header", O_CREAT | O_RDWR, 0666);
+    if (fileHandle == -1)
+        return false;
+
+    unsigned int indexSize = IndexSize(Profiler::capacity);
+    size_t size = sizeof(Profiler::Header) + indexSize * sizeof(int);
+    if (ftruncate(fileHandle, size) == -1)
+        return false;
+
+    void* view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fileHandle, 0);
+    if (view == MAP_FAILED)
+        return false;
+
+    Header* created = (Profiler::Header*) view;
+    created->functionCount = 0;
+    created->generation++;
+    created->capacity = Profiler::capacity;
+    created->indexSize = indexSize;
+    memset(created->FunctionIndex(), 0, indexSize * sizeof(int));
+    for (auto&& ring : created->rings)
+        new (&ring) EventRing();
+
+    // Segments left behind by an earlier host could have another layout.
+    unsigned int segmentCount = SegmentCount(created->capacity);
+    char name[64];
+    for (unsigned int i = 0; i < segmentCount; i++)
+    {
+        snprintf(name, sizeof(name), "/Profiler.Segment.%u", i);
+        shm_unlink(name);
+    }
+    segments = std::make_unique<SegmentHandle[]>(segmentCount);
+    this->size = size;
+    isOwner = true;
+    header = created;
+
+    return true;
+}
+
+bool Profiler::HeaderHandle::Open()
+{
+    if (fileHandle == -1)
+        fileHandle = shm_open("/Profiler.Header", O_RDWR, 0666);
+    if (fileHandle == -1)
+        return false;
+
+    struct stat info;
+    if (fstat(fileHandle, &info) == -1 || info.st_size < (off_t) sizeof(Profiler::Header))
+        return false;
+
+    void* view = mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fileHandle, 0);
+    if (view == MAP_FAILED)
+        return false;
+
+    Header* opened = (Profiler::Header*) view;
+    if (opened->capacity.segmentFunctions == 0 || info.st_size < (off_t) (sizeof(Profiler::Header) + opened->indexSize * sizeof(int)))
+    {
+        munmap(view, info.st_size);
+        return false;
+    }
+
+    segments = std::make_unique<SegmentHandle[]>(SegmentCount(opened->capacity));
+    size = info.st_size;
+    header = opened;
+    return true;
+}
+
+Profiler::HeaderHandle::~HeaderHandle()
+{
+    segments.reset();
+    if (header && isOwner)
+    {
+        char name[64];
+        for (unsigned int i = 0; i < SegmentCount(header->capacity); i++)
+        {
+            snprintf(name, sizeof(name), "/Profiler.Segment.%u", i);
+            shm_unlink(name);
+        }
+    }
+    if (header)
+        munmap(header, size);
+    if (fileHandle != -1)
+        close(fileHandle);
+    if (isOwner)
+        shm_unlink("/Profiler.Header");
+}
+
+Profiler::SegmentHandle::SegmentHandle() :fileHandle(-1), size(0), functions(nullptr) {}
+
+bool Profiler::SegmentHandle::Map(unsigned int index, size_t size)
+{
+    if (functions.load(std::memory_order_relaxed))
+        return true;
+
+    char name[64];
+    snprintf(name, sizeof(name), "/Profiler.Segment.%u", index);
+    if (fileHandle == -1)
+        fileHandle = shm_open(name, O_CREAT | O_RDWR, 0666);
+    if (fileHandle == -1)
+        return false;
+
+    struct stat info;
+    if (fstat(fileHandle, &info) == -1)
+        return false;
+    if (info.st_size < (off_t) size && ftruncate(fileHandle, size) == -1)
+        return false;
+
+    void* view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fileHandle, 0);
+    if (view == MAP_FAILED)
+        return false;
+
+    this->size = size;
+    functions.store((Function*) view, std::memory_order_release);
+    return true;
+}
+
+Profiler::SegmentHandle::~SegmentHandle()
+{
+    if (functions)
+        munmap(functions, size);
+    if (fileHandle != -1)
+        close(fileHandle);
+}
+#endif
+
 inline Profiler::HeaderHandle Profiler::headerHandle;
-inline bool Profiler::isFrameActive = false;
\ No newline at end of file
+inline Profiler::Capacity Profiler::capacity;
+inline std::mutex Profiler::headerMutex;
+inline std::mutex Profiler::segmentMutex;
+inline thread_local Profiler::ThreadHandle Profiler::threadHandle;
+inline std::mutex Profiler::collectorMutex;
+inline std::mutex Profiler::registryMutex;
+inline Profiler::ThreadState Profiler::threadStates[Profiler::maxThreads];
+inline std::atomic<bool> Profiler::hasFrames = false;
+inline std::atomic<bool> Profiler::compensateOverhead = false;
+inline std::once_flag Profiler::calibrationFlag;
+inline long long Profiler::zoneOverhead = 0;
+inline long long Profiler::measuredOverhead = 0;
+inline unsigned int Profiler::mergedZones = 0;
+inline std::jthread Profiler::collector;
+#endif
\ No newline at end of file
@@ -4,17 +4,38 @@
 #include <chrono>
 #include <source_location>
 #include <thread>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <memory>
+#include <iosfwd>
 
 class Profiler
 {
 public:
-    static const unsigned int maxFunctions = 32;
     static const unsigned int maxFunctionNameLength = 128;
-    static const unsigned int maxSampleCount = 16384;
+    static const unsigned int maxThreads = 16;
+    static const unsigned int eventRingSize = 16384;
 
     class Function;
     static void BeginFrame();
     static void EndFrame();
+
+    struct Capacity
+    {
+        // Zones that can exist at once, sizes the id index.
+        unsigned int functions = 4096;
+        // Zones per shared segment, segments are mapped only once a zone lands in them.
+        unsigned int segmentFunctions = 64;
+        // Most samples of history a zone can keep.
+        unsigned int samples = 16384;
+        // Samples the pool of a segment holds for all its zones, zones only take blocks as their history fills.
+        unsigned int segmentSamples = 2 * segmentFunctions * samples;
+    };
+    // Only the process creating the shared memory, the host, decides the capacity and it has to do so before the first zone.
+    static void SetCapacity(const Capacity& capacity);
+    static Capacity GetCapacity();
+
     class Samples
     {
         double totalSum;
@@ -25,13 +46,23 @@ public:
         unsigned int totalSampleCount;
         unsigned int sampleLimit;
         float currentSample;
-        float samples[maxSampleCount];
+        bool estimated;
+        bool owned;
+        bool pooled;
+        unsigned int capacity;
+        // Distance from this to the samples, they live in the pool of a shared segment or on the heap for copies.
+        long long storage;
         friend Function;
-        friend void Profiler::BeginFrame();
-        friend void Profiler::EndFrame();
+        friend Profiler;
+
+        float* Storage() const;
+        unsigned int Limit() const;
 
     public:
         Samples();
+        Samples(const Samples& other);
+        Samples& operator=(const Samples& other);
+        ~Samples();
 
         std::span<float> Data();
         std::span<const float> Data() const;
@@ -44,9 +75,14 @@ public:
         float GetTotalMax() const;
         unsigned int GetTotalSampleCount() const;
         float GetCurrent() const;
+        // The current sample was extrapolated from a subset of timed invocations.
+        bool IsEstimated() const;
+        unsigned int GetCapacity() const;
         unsigned int& GetSampleLimit();
         void SetSampleLimit(unsigned int sampleLimit);
         void UnwindOffset();
+        void Write(std::ostream& file) const;
+        void Read(std::istream& file);
 
     private:
         void BeginAccumulate();
@@ -59,15 +95,29 @@ public:
         Time, Memory, Count
     };
 
+    enum SamplingMode
+    {
+        EveryNth, Random
+    };
+
     class Function
     {
         int programID;
         FunctionType type;
+        unsigned long long id;
+        unsigned int line;
+        unsigned int index;
         char name[maxFunctionNameLength];
         Samples samples;
+        Samples selfSamples;
+        int parent;
         int invocations;
         int lastInvocations;
-        std::chrono::high_resolution_clock::time_point sampleStart;
+        unsigned int samplingRate;
+        SamplingMode samplingMode;
+        bool estimated;
+
+        void EndAccumulate();
 
     public:
         Function(const char* name = "", FunctionType type = FunctionType::Time);
@@ -75,9 +125,21 @@ public:
         char* GetName();
         const char* GetName() const;
         FunctionType GetType() const;
+        unsigned int GetIndex() const;
+        // Line of the PROFILE_FUNCTION call site, 0 for zones identified by name.
+        unsigned int GetLine() const;
         int GetInvocations() const;
         Samples& GetSamples();
         const Samples& GetSamples() const;
+        Samples& GetSelfSamples();
+        const Samples& GetSelfSamples() const;
+        Function* GetParent();
+        unsigned int GetSamplingRate() const;
+        SamplingMode GetSamplingMode() const;
+        // Times only one in rate invocations and extrapolates the totals, every invocation is still counted.
+        void SetSamplingRate(unsigned int rate, SamplingMode mode = EveryNth);
+        void Write(std::ostream& file) const;
+        void Read(std::istream& file);
 
         void AddSample(float sample);
         void BeginSample();
@@ -89,49 +151,260 @@ public:
         friend Profiler;
     };
 
+    struct FunctionHandle
+    {
+        const char* name;
+        unsigned long long id;
+        unsigned int line;
+        Function* function;
+        unsigned int generation;
+
+        constexpr FunctionHandle(const char* name) :name(name), id(HashName(name)), line(0), function(nullptr), generation(0) {}
+        constexpr FunctionHandle(const std::source_location& location) :name(location.function_name()), id(HashLocation(location)), line(location.line()), function(nullptr), generation(0) {}
+        Function* Get();
+    };
+
     struct ScopedFunction
     {
         Function* function;
         ScopedFunction(const char* name);
+        ScopedFunction(Function* function);
         ~ScopedFunction();
     };
 
+    enum EventType
+    {
+        BeginEvent, EndEvent, SampleEvent
+    };
+
+    struct Event
+    {
+        unsigned int function;
+        EventType type;
+        union
+        {
+            long long time;
+            float value;
+        };
+    };
+
+    class EventRing
+    {
+        std::atomic<bool> claimed;
+        int programID;
+        alignas(64) std::atomic<unsigned int> head;
+        unsigned int cachedTail;
+        alignas(64) std::atomic<unsigned int> tail;
+        Event events[eventRingSize];
+
+    public:
+        EventRing();
+
+        bool Push(const Event& event);
+        unsigned int Pop(std::span<Event> batch);
+
+        friend Profiler;
+    };
+
+    class FunctionRange
+    {
+        unsigned int count;
+
+    public:
+        struct Iterator
+        {
+            unsigned int index;
+
+            Function& operator*() const { return *FunctionAt(index); }
+            Iterator& operator++() { index++; return *this; }
+            bool operator!=(const Iterator& rhs) const { return index != rhs.index; }
+        };
+
+        FunctionRange(unsigned int count = 0) :count(count) {}
+        Iterator begin() const { return { 0 }; }
+        Iterator end() const { return { count }; }
+        unsigned int size() const { return count; }
+        Function& operator[](unsigned int index) const { return *FunctionAt(index); }
+    };
+
     static void SetHightPriority();
+    static void SetOverheadCompensation(bool enabled);
+    static double GetZoneOverhead();
+    static void Collect();
+    // Drains the event rings from a background thread, so instrumented threads never wait on a full ring.
+    static void StartCollector(std::chrono::milliseconds interval = std::chrono::milliseconds(1));
+    static void StopCollector();
     static Function* AddFunction(const char* name, FunctionType type = FunctionType::Time);
     static Function* GetFunction(const char* name);
     static void RemoveFunction(const char* name);
-    static std::span<Function> GetFunctions();
+    static void RemoveFunction(Function* function);
+    static FunctionRange GetFunctions();
 
     static void BeginFunction(const char* name = std::source_location::current().function_name());
     static void EndFunction(const char* name = std::source_location::current().function_name());
 
 private:
+    // Functions live in segments of their own, the header only holds the id index behind it.
     struct Header
     {
         int functionCount;
-        Function functions[maxFunctions];
+        unsigned int generation;
+        Capacity capacity;
+        unsigned int indexSize;
+        EventRing rings[maxThreads];
+
+        int* FunctionIndex() { return (int*) (this + 1); }
+    };
+
+    // Follows the functions of every segment, sample history is handed out from it in power of two blocks.
+    struct Pool
+    {
+        std::atomic<bool> locked;
+        unsigned int used;
+        // One past the first free block of every size, free blocks link to the next one through their first word.
+        unsigned int freeBlocks[32];
+
+        float* Data() { return (float*) (this + 1); }
     };
     const int a = sizeof(Header);
 
+    struct SegmentHandle
+    {
+#ifdef _WIN32
+        void* fileHandle;
+#else
+        int fileHandle;
+        size_t size;
+#endif
+        std::atomic<Function*> functions;
+
+        SegmentHandle();
+        bool Map(unsigned int index, size_t size);
+        ~SegmentHandle();
+    };
+
     struct HeaderHandle
     {
+#ifdef _WIN32
         void* fileHandle;
         Header* header;
 
         HeaderHandle() :fileHandle(nullptr), header(nullptr) {}
+#else
+        int fileHandle;
+        Header* header;
+        size_t size;
+        bool isOwner;
+
+        HeaderHandle() :fileHandle(-1), header(nullptr), size(0), isOwner(false) {}
+#endif
+        std::unique_ptr<SegmentHandle[]> segments;
+
         bool Create();
         bool Open();
         ~HeaderHandle();
     };
+    struct OpenZone
+    {
+        Event begin;
+        long long childTime;
+        unsigned int children;
+        unsigned int descendants;
+    };
+
+    struct ZoneTotals
+    {
+        unsigned int invocations;
+        unsigned int untimed;
+        long long time;
+        long long selfTime;
+        double value;
+    };
+
+    struct ZoneAccumulator
+    {
+        std::atomic<unsigned int> invocations;
+        std::atomic<unsigned int> untimed;
+        std::atomic<long long> time;
+        std::atomic<long long> selfTime;
+        std::atomic<double> value;
+        std::atomic<int> parent;
+
+        ZoneTotals Load() const;
+    };
+
+    struct ThreadState
+    {
+        unsigned int generation;
+        std::vector<OpenZone> open;
+        std::vector<unsigned int> depths;
+        std::vector<int> sampling;
+        std::vector<unsigned int> skipped;
+        unsigned int random;
+        std::unique_ptr<ZoneAccumulator[]> accumulators;
+        std::unique_ptr<ZoneTotals[]> merged;
+    };
+
+    struct ThreadHandle
+    {
+        int index;
+
+        ThreadHandle() :index(-1) {}
+        ~ThreadHandle();
+    };
+
     static bool InitHeader();
+    static Function* FunctionAt(unsigned int index);
+    static size_t SegmentSize(const Capacity& capacity);
+    static Pool& PoolOf(Function& function);
+    static float* Allocate(Pool& pool, unsigned int size);
+    static void Free(Pool& pool, float* block, unsigned int size);
+    static bool Resize(Function& function, Samples& samples, unsigned int size);
+    static void Reserve(Function& function, Samples& samples);
+    static ThreadState* GetThreadState();
+    static void Calibrate();
+    static bool BeginTiming(ThreadState& thread, Function& function);
+    static bool EndTiming(ThreadState& thread, unsigned int function);
+    static void Record(const Event& event);
+    static void Aggregate(ThreadState& thread, const Event& event);
+    static void Merge(ThreadState& thread, unsigned int function);
+    static void Merge(ThreadState& thread);
+    static void Publish(unsigned int function);
+    static Function* AddFunction(const char* name, unsigned long long id, unsigned int line, FunctionType type = FunctionType::Time);
+    static constexpr unsigned long long HashName(const char* name, unsigned long long hash = 14695981039346656037ull);
+    static constexpr unsigned long long HashLocation(const std::source_location& location);
+    static int& FindIndexEntry(unsigned long long id);
+    static void EraseIndexEntry(int position);
     static HeaderHandle headerHandle;
-    static bool isFrameActive;
+    static Capacity capacity;
+    static std::mutex headerMutex;
+    static std::mutex segmentMutex;
+    static thread_local ThreadHandle threadHandle;
+    static std::mutex collectorMutex;
+    static std::mutex registryMutex;
+    static ThreadState threadStates[maxThreads];
+    static std::atomic<bool> hasFrames;
+    static std::atomic<bool> compensateOverhead;
+    static std::once_flag calibrationFlag;
+    static long long zoneOverhead;
+    static long long measuredOverhead;
+    static unsigned int mergedZones;
+    static std::jthread collector;
 };
 
 #define CONCAT_IMPL( x, y ) x##y
 #define MACRO_CONCAT( x, y ) CONCAT_IMPL( x, y )
-#define PROFILE_NAMED_FUNCTION(name) Profiler::ScopedFunction MACRO_CONCAT(___SCOPED_FUNCTION_OBJECT___, __COUNTER__)(name)
-#define PROFILE_FUNCTION() Profiler::ScopedFunction MACRO_CONCAT(___SCOPED_FUNCTION_OBJECT___, __COUNTER__)(std::source_location::current().function_name())
+#if defined(PROFILER_DISABLED) && !defined(PROFILER_HOST)
+#define PROFILE_NAMED_FUNCTION(name)
+#define PROFILE_FUNCTION()
+#else
+#define PROFILE_SCOPE_IMPL(id, ...) static Profiler::FunctionHandle MACRO_CONCAT(___FUNCTION_HANDLE___, id)(__VA_ARGS__); Profiler::ScopedFunction MACRO_CONCAT(___SCOPED_FUNCTION_OBJECT___, id)(MACRO_CONCAT(___FUNCTION_HANDLE___, id).Get())
+// The Function is resolved once per call site, so name has to stay the same for every invocation.
+// Zones with names computed at runtime should construct Profiler::ScopedFunction from the name directly.
+#define PROFILE_NAMED_FUNCTION(name) PROFILE_SCOPE_IMPL(__COUNTER__, name)
+// Every call site is its own zone, identified by a hash of file, function and line computed at compile time.
+#define PROFILE_FUNCTION() PROFILE_SCOPE_IMPL(__COUNTER__, std::source_location::current())
+#endif
 
 
 inline bool Profiler::InitHeader()
@@ -139,9 +412,27 @@ inline bool Profiler::InitHeader()
     if (headerHandle.header)
         return true;
 
+    std::lock_guard lock(headerMutex);
+    if (headerHandle.header)
+        return true;
 #ifdef PROFILER_HOST
     return headerHandle.Create();
 #else
     return headerHandle.Open();
 #endif
+}
+
+constexpr unsigned long long Profiler::HashName(const char* name, unsigned long long hash)
+{
+    for (unsigned int i = 0; name[i] != 0; i++)
+        hash = (hash ^ (unsigned char) name[i]) * 1099511628211ull;
+    return hash;
+}
+
+constexpr unsigned long long Profiler::HashLocation(const std::source_location& location)
+{
+    unsigned long long hash = HashName(location.function_name(), HashName(location.file_name()));
+    for (unsigned int line = location.line(); line != 0; line >>= 8)
+        hash = (hash ^ (line & 0xff)) * 1099511628211ull;
+    return hash;
 }
\ No newline at end of file
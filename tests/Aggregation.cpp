@@ -0,0 +1,252 @@
+#define PROFILER_HOST
+#include "Profiler.h"
+#include "Profiler.cpp"
+#include <cstdio>
+#include <cmath>
+#include <sstream>
+
+#define CHECK(condition) if (!(condition)) { printf("Failed: %s\n", #condition); return 1; }
+
+static const int threadCount = 4;
+static const int zonesPerThread = 50'000;
+
+void Spin(std::chrono::microseconds duration)
+{
+    auto start = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - start < duration);
+}
+
+void Child()
+{
+    PROFILE_NAMED_FUNCTION("Child");
+    Spin(std::chrono::microseconds(200));
+}
+
+void Parent()
+{
+    PROFILE_NAMED_FUNCTION("Parent");
+    Spin(std::chrono::microseconds(500));
+    for (int i = 0; i < 5; i++)
+        Child();
+}
+
+void Recursive(int depth)
+{
+    PROFILE_NAMED_FUNCTION("Recursive");
+    Spin(std::chrono::microseconds(100));
+    if (depth > 0)
+        Recursive(depth - 1);
+}
+
+bool Near(float a, float b)
+{
+    return std::abs(a - b) <= 1e-3f * std::max(std::abs(a), std::abs(b));
+}
+
+void Empty()
+{
+    PROFILE_NAMED_FUNCTION("Empty");
+}
+
+void Outer()
+{
+    PROFILE_NAMED_FUNCTION("Outer");
+    for (int i = 0; i < 10'000; i++)
+        Empty();
+}
+
+void Hot()
+{
+    PROFILE_NAMED_FUNCTION("Hot");
+    Spin(std::chrono::microseconds(20));
+}
+
+void HotLoop()
+{
+    PROFILE_NAMED_FUNCTION("HotLoop");
+    for (int i = 0; i < 500; i++)
+        Hot();
+}
+
+void TwoScopes()
+{
+    {
+        PROFILE_FUNCTION();
+    }
+    {
+        PROFILE_FUNCTION();
+    }
+}
+
+void Worker()
+{
+    for (int i = 0; i < zonesPerThread; i++)
+    {
+        PROFILE_NAMED_FUNCTION("Worker");
+    }
+}
+
+int main()
+{
+    Profiler::BeginFrame();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < threadCount; i++)
+        threads.emplace_back(Worker);
+    for (auto&& thread : threads)
+        thread.join();
+    Profiler::EndFrame();
+
+    Profiler::Function* worker = Profiler::GetFunction("Worker");
+    CHECK(worker);
+    CHECK(worker->GetInvocations() == threadCount * zonesPerThread);
+    CHECK(worker->GetSamples().GetTotalSampleCount() == 1);
+    CHECK(worker->GetSamples().GetCurrent() > 0);
+
+    threads.clear();
+    for (int i = 0; i < threadCount; i++)
+        threads.emplace_back(Worker);
+    int invocations = 0;
+    while (invocations < threadCount * zonesPerThread)
+    {
+        Profiler::BeginFrame();
+        Profiler::EndFrame();
+        invocations += worker->GetInvocations();
+    }
+    for (auto&& thread : threads)
+        thread.join();
+    CHECK(invocations == threadCount * zonesPerThread);
+
+    Profiler::StartCollector();
+    Profiler::BeginFrame();
+    threads.clear();
+    for (int i = 0; i < threadCount; i++)
+        threads.emplace_back(Worker);
+    for (auto&& thread : threads)
+        thread.join();
+    Profiler::EndFrame();
+    Profiler::StopCollector();
+    CHECK(worker->GetInvocations() == threadCount * zonesPerThread);
+
+    Profiler::Function* value = Profiler::AddFunction("Value", Profiler::Count);
+    Profiler::BeginFrame();
+    value->AddSample(1.5f);
+    value->AddSample(2.5f);
+    Profiler::EndFrame();
+    CHECK(value->GetInvocations() == 2);
+    CHECK(value->GetSamples().GetCurrent() == 4.0f);
+
+    value->AddSample(3.0f);
+    Profiler::BeginFrame();
+    Profiler::EndFrame();
+    CHECK(value->GetInvocations() == 1);
+    CHECK(value->GetSamples().GetCurrent() == 3.0f);
+    CHECK(value->GetSamples().GetTotalSampleCount() == 2);
+
+    Profiler::BeginFrame();
+    Parent();
+    Profiler::EndFrame();
+    Profiler::Function* parent = Profiler::GetFunction("Parent");
+    Profiler::Function* child = Profiler::GetFunction("Child");
+    CHECK(parent && child);
+    CHECK(child->GetParent() == parent);
+    CHECK(!parent->GetParent());
+    CHECK(child->GetInvocations() == 5);
+    CHECK(Near(child->GetSelfSamples().GetCurrent(), child->GetSamples().GetCurrent()));
+    CHECK(Near(parent->GetSelfSamples().GetCurrent() + child->GetSamples().GetCurrent(), parent->GetSamples().GetCurrent()));
+    CHECK(parent->GetSelfSamples().GetCurrent() >= 0.5f);
+    CHECK(child->GetSamples().GetCurrent() >= 1.0f);
+
+    Profiler::BeginFrame();
+    Recursive(5);
+    Recursive(5);
+    Profiler::EndFrame();
+    Profiler::Function* recursive = Profiler::GetFunction("Recursive");
+    CHECK(recursive);
+    CHECK(recursive->GetInvocations() == 12);
+    CHECK(!recursive->GetParent());
+    CHECK(Near(recursive->GetSelfSamples().GetCurrent(), recursive->GetSamples().GetCurrent()));
+    CHECK(recursive->GetSamples().GetCurrent() >= 1.2f);
+
+    CHECK(Profiler::GetZoneOverhead() > 0);
+    Profiler::BeginFrame();
+    Outer();
+    Profiler::EndFrame();
+    Profiler::Function* outer = Profiler::GetFunction("Outer");
+    Profiler::Function* empty = Profiler::GetFunction("Empty");
+    Profiler::Function* overhead = Profiler::GetFunction("Profiler Overhead");
+    CHECK(outer && empty && overhead);
+    CHECK(overhead->GetInvocations() == 10'001);
+    CHECK(Near(overhead->GetSamples().GetCurrent(), 10'001 * Profiler::GetZoneOverhead()));
+
+    float outerSelf[2] = { FLT_MAX, FLT_MAX };
+    float emptyTime[2] = { FLT_MAX, FLT_MAX };
+    for (int compensate = 0; compensate < 2; compensate++)
+    {
+        Profiler::SetOverheadCompensation(compensate);
+        for (int frame = 0; frame < 10; frame++)
+        {
+            Profiler::BeginFrame();
+            Outer();
+            Profiler::EndFrame();
+            outerSelf[compensate] = std::min(outerSelf[compensate], outer->GetSelfSamples().GetCurrent());
+            emptyTime[compensate] = std::min(emptyTime[compensate], empty->GetSamples().GetCurrent());
+        }
+    }
+    Profiler::SetOverheadCompensation(false);
+    CHECK(outerSelf[1] < outerSelf[0]);
+    CHECK(emptyTime[1] < emptyTime[0]);
+
+    Profiler::BeginFrame();
+    HotLoop();
+    Profiler::EndFrame();
+    Profiler::Function* hot = Profiler::GetFunction("Hot");
+    Profiler::Function* hotLoop = Profiler::GetFunction("HotLoop");
+    CHECK(hot && hotLoop);
+    CHECK(!hot->GetSamples().IsEstimated());
+    float hotTime = hot->GetSamples().GetCurrent();
+
+    for (auto mode : { Profiler::EveryNth, Profiler::Random })
+    {
+        hot->SetSamplingRate(10, mode);
+        Profiler::BeginFrame();
+        HotLoop();
+        Profiler::EndFrame();
+        CHECK(hot->GetInvocations() == 500);
+        CHECK(hot->GetSamples().IsEstimated());
+        CHECK(!hotLoop->GetSamples().IsEstimated());
+        CHECK(std::abs(hot->GetSamples().GetCurrent() - hotTime) < 0.5f * hotTime);
+        CHECK(hotLoop->GetSelfSamples().GetCurrent() < 0.5f * hotTime);
+    }
+    hot->SetSamplingRate(1);
+    Profiler::BeginFrame();
+    HotLoop();
+    Profiler::EndFrame();
+    CHECK(hot->GetInvocations() == 500);
+    CHECK(!hot->GetSamples().IsEstimated());
+
+    Profiler::BeginFrame();
+    TwoScopes();
+    TwoScopes();
+    Profiler::EndFrame();
+    std::vector<Profiler::Function*> scopes;
+    for (auto&& function : Profiler::GetFunctions())
+        if (strstr(function.GetName(), "TwoScopes"))
+            scopes.push_back(&function);
+    CHECK(scopes.size() == 2);
+    CHECK(scopes[0]->GetLine() != scopes[1]->GetLine());
+    CHECK(scopes[0]->GetInvocations() == 2 && scopes[1]->GetInvocations() == 2);
+    CHECK(!Profiler::GetFunction(scopes[0]->GetName()));
+
+    std::stringstream file;
+    parent->Write(file);
+    Profiler::Function loaded;
+    loaded.Read(file);
+    std::vector<Profiler::Function> copies(3, loaded);
+    CHECK(strcmp(copies[2].GetName(), "Parent") == 0);
+    CHECK(copies[2].GetSamples().GetTotalSampleCount() == parent->GetSamples().GetTotalSampleCount());
+    CHECK(copies[2].GetSamples().GetCurrent() == parent->GetSamples().GetCurrent());
+    CHECK(copies[2].GetSelfSamples().GetAverage() == parent->GetSelfSamples().GetAverage());
+
+    printf("Passed\n");
+    return 0;
+}
@@ -0,0 +1,48 @@
+#define PROFILER_HOST
+#include "Profiler.h"
+#include "Profiler.cpp"
+#include <cstdio>
+#include <string>
+
+static const int zoneCount = 1'000'000;
+static const int frameCount = 10;
+static volatile long long sink;
+
+template<typename Zone>
+double Measure(Zone zone, bool profile = true)
+{
+    double best = 1e300;
+    for (int frame = 0; frame < frameCount; frame++)
+    {
+        if (profile) Profiler::BeginFrame();
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < zoneCount; i++)
+            zone();
+        auto end = std::chrono::steady_clock::now();
+        if (profile) Profiler::EndFrame();
+
+        double duration = std::chrono::duration<double, std::nano>(end - start).count() / zoneCount;
+        if (duration < best) best = duration;
+    }
+    return best;
+}
+
+int main()
+{
+    for (int i = 0; i < 1000; i++)
+        Profiler::AddFunction(("Filler" + std::to_string(i)).c_str());
+
+    double empty = Measure([]() {});
+    double chronoClock = Measure([]() { sink = std::chrono::high_resolution_clock::now().time_since_epoch().count(); }, false);
+    double profilerClock = Measure([]() { sink = Now(); }, false);
+    double lookup = Measure([]() { Profiler::ScopedFunction zone("LookupZone"); });
+    double cached = Measure([]() { PROFILE_NAMED_FUNCTION("CachedZone"); });
+
+    printf("Clock source: %s\n", ClockName());
+    printf("%-24s%12s%12s\n", "Zone", "ns/zone", "overhead");
+    printf("%-24s%12.2f%12.2f\n", "Empty loop", empty, 0.0);
+    printf("%-24s%12.2f%12.2f\n", "high_resolution_clock", chronoClock, chronoClock - empty);
+    printf("%-24s%12.2f%12.2f\n", "Profiler clock", profilerClock, profilerClock - empty);
+    printf("%-24s%12.2f%12.2f\n", "Name lookup", lookup, lookup - empty);
+    printf("%-24s%12.2f%12.2f\n", "Cached call site", cached, cached - empty);
+}
@@ -42,8 +42,7 @@ bool SaveFileDialog(char* fileName)
 
 void SaveFunction(Profiler::Function& function, std::ofstream& file)
 {
-    function.GetSamples().UnwindOffset();
-    file.write((char*) &function, sizeof(function));
+    function.Write(file);
 }
 
 void SaveFunction(Profiler::Function& function, const char* filePath)
@@ -56,7 +55,7 @@ Profiler::Function LoadFunction(std::ifstream& file, const char* funcName)
 {
     Profiler::Function function("");
     if (file.is_open())
-        file.read((char*) &function, sizeof(function));
+        function.Read(file);
 
     strncpy(function.GetName(), funcName, Profiler::maxFunctionNameLength);
     return function;
@@ -106,7 +105,7 @@ struct Settings
     }
 };
 
-Settings settings[Profiler::maxFunctions];
+std::vector<Settings> settings;
 
 static void ReadSettings()
 {
@@ -114,8 +113,11 @@ static void ReadSettings()
     if (file.is_open())
     {
         file >> Renderer::w >> Renderer::h >> Renderer::x >> Renderer::y >> Renderer::prevH >> Renderer::prevW >> Renderer::prevX >> Renderer::prevY >> Renderer::isMaximized;
-        for (int i = 0; i < Profiler::maxFunctions; i++)
-            settings[i].Read(file);
+        while ((file >> std::ws).peek() != EOF)
+        {
+            settings.emplace_back();
+            settings.back().Read(file);
+        }
 
         file.close();
     }
@@ -127,7 +129,7 @@ static void WriteSettings()
     if (file.is_open())
     {
         file << Renderer::w << ' ' << Renderer::h << ' ' << Renderer::x << ' ' << Renderer::y << ' ' << Renderer::prevH << ' ' << Renderer::prevW << ' ' << Renderer::prevX << ' ' << Renderer::prevY << ' ' << Renderer::isMaximized << '\n';
-        for (int i = 0; i < Profiler::GetFunctions().size(); i++)
+        for (int i = 0; i < Profiler::GetFunctions().size() && i < settings.size(); i++)
             settings[i].Write(file);
 
         file.close();
@@ -136,7 +138,9 @@ static void WriteSettings()
 
 int GetOffset(Profiler::Function& function)
 {
-    return &function - &Profiler::GetFunctions()[0];
+    if (function.GetIndex() >= settings.size())
+        settings.resize(function.GetIndex() + 1, { 2.4f, 110, (int) Profiler::GetCapacity().samples });
+    return function.GetIndex();
 }
 
 std::tuple<float, const char*> TransfomWithSuffix(float value, Profiler::FunctionType type)
@@ -203,10 +207,21 @@ void DrawFunction(Profiler::Function& function)
     ImGui::TableNextRow();
     ImGui::TableNextColumn();
     ImGui::Text(function.GetName());
+    if (Profiler::Function* parent = function.GetParent())
+        ImGui::TextDisabled("Parent: %s", parent->GetName());
+    if (function.GetLine() != 0)
+        ImGui::TextDisabled("Line: %u", function.GetLine());
     ImGui::PushStyleVar(ImGuiStyleVar_FrameRounding, 15.0f);
     ImGui::SliderInt("Height", &settings[GetOffset(function)].height, 110, 1000);
-    ImGui::SliderInt("Limit", &settings[GetOffset(function)].limit, 1, Profiler::maxSampleCount);
+    ImGui::SliderInt("Limit", &settings[GetOffset(function)].limit, 1, (int) Profiler::GetCapacity().samples);
     ImGui::SliderFloat("Line", &settings[GetOffset(function)].width, 0.2, 7, "%.1f");
+    if (function.GetType() == Profiler::Time)
+    {
+        int rate = function.GetSamplingRate();
+        bool random = function.GetSamplingMode() == Profiler::Random;
+        if (ImGui::SliderInt("Sampling", &rate, 1, 1000, "1 in %d") | ImGui::Checkbox("Random", &random))
+            function.SetSamplingRate(rate, random ? Profiler::Random : Profiler::EveryNth);
+    }
     ImGui::PopStyleVar();
     if (ImGui::Button("Save"))
     {
@@ -245,10 +260,12 @@ void DrawFunction(Profiler::Function& function)
         }
         else
         {
-            Profiler::RemoveFunction(function.GetName());
+            Profiler::RemoveFunction(&function);
         }
     }
+    settings[GetOffset(function)].limit = std::clamp<int>(settings[GetOffset(function)].limit, 1, (int) Profiler::GetCapacity().samples);
     function.GetSamples().SetSampleLimit(settings[GetOffset(function)].limit);
+    function.GetSelfSamples().SetSampleLimit(settings[GetOffset(function)].limit);
     ImGui::TableNextColumn();
 
     switch (function.GetType())
@@ -258,14 +275,22 @@ void DrawFunction(Profiler::Function& function)
     default:break;
     }
 
+    const char* estimate = samples.IsEstimated() ? "~" : "";
     auto t = TransfomWithSuffix(samples.GetCurrent(), function.GetType());
-    ImGui::Text("Current: %.3g%s", std::get<0>(t), std::get<1>(t));
+    ImGui::Text("Current: %s%.3g%s", estimate, std::get<0>(t), std::get<1>(t));
     t = TransfomWithSuffix(samples.GetMax(), function.GetType());
     ImGui::Text("Max: %.3g%s", std::get<0>(t), std::get<1>(t));
     t = TransfomWithSuffix(samples.GetMin(), function.GetType());
     ImGui::Text("Min: %.3g%s", std::get<0>(t), std::get<1>(t));
     t = TransfomWithSuffix(samples.GetAverage(), function.GetType());
     ImGui::Text("Avg: %.3g%s", std::get<0>(t), std::get<1>(t));
+    if (function.GetType() == Profiler::Time)
+    {
+        t = TransfomWithSuffix(function.GetSelfSamples().GetAverage(), function.GetType());
+        ImGui::Text("Self: %.3g%s", std::get<0>(t), std::get<1>(t));
+    }
+    if (samples.IsEstimated())
+        ImGui::TextDisabled("Estimated from 1 in %u", function.GetSamplingRate());
     if (refFunction.size() != 0)
     {
         float diff = samples.GetAverage() - refFunction[0].GetSamples().GetAverage();
@@ -292,6 +317,11 @@ void DrawFunction(Profiler::Function& function)
     ImGui::Text("Min: %.3g%s", std::get<0>(t), std::get<1>(t));
     t = TransfomWithSuffix(samples.GetTotalAverage(), function.GetType());
     ImGui::Text("Avg: %.3g%s", std::get<0>(t), std::get<1>(t));
+    if (function.GetType() == Profiler::Time)
+    {
+        t = TransfomWithSuffix(function.GetSelfSamples().GetTotalAverage(), function.GetType());
+        ImGui::Text("Self: %.3g%s", std::get<0>(t), std::get<1>(t));
+    }
     if (refFunction.size() != 0)
     {
         float diff = samples.GetTotalAverage() - refFunction[0].GetSamples().GetTotalAverage();
@@ -351,7 +381,7 @@ void DrawFunction(Profiler::Function& function)
         ImPlot::PlotLine("Current", samples.Data().data(), samples.Data().size(), 1.0, 0.0, 0, samples.GetOffset());
         for (auto&& func : refFunction)
         {
-            auto referance = func.GetSamples();
+            auto& referance = func.GetSamples();
             int size = samples.Data().size();
             if (referance.Data().size() < size) size = referance.Data().size();
             ImPlot::PlotLine(func.GetName(), referance.Data().data(), size, 1.0, 0.0, 0, referance.GetOffset());
@@ -364,12 +394,6 @@ void DrawFunction(Profiler::Function& function)
 
 int main()
 {
-    for (int i = 0; i < Profiler::maxFunctions; i++)
-    {
-        settings[i].width = 2.4;
-        settings[i].height = 110;
-        settings[i].limit = Profiler::maxSampleCount;
-    }
     ReadSettings();
     Renderer::Init();
     SetPriorityClass(GetCurrentProcess(), IDLE_PRIORITY_CLASS);
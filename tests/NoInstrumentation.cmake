@@ -0,0 +1,11 @@
+# Fails when BINARY still contains profiler symbols or call site handles.
+execute_process(COMMAND "${NM}" -C "${BINARY}" OUTPUT_VARIABLE SYMBOLS RESULT_VARIABLE RESULT)
+if(NOT RESULT EQUAL 0)
+    message(FATAL_ERROR "Could not list symbols of ${BINARY}")
+endif()
+
+string(REGEX MATCHALL "[^\n]*(Profiler|FUNCTION_HANDLE)[^\n]*" INSTRUMENTATION "${SYMBOLS}")
+if(INSTRUMENTATION)
+    list(JOIN INSTRUMENTATION "\n" INSTRUMENTATION)
+    message(FATAL_ERROR "Instrumentation left in ${BINARY}:\n${INSTRUMENTATION}")
+endif()
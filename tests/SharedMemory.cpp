@@ -0,0 +1,108 @@
+#include "Profiler.h"
+#include "Profiler.cpp"
+#include <cstdio>
+#include <string>
+#include <sys/wait.h>
+
+static const int frameCount = 10;
+static const int zonesPerFrame = 3;
+static const unsigned int functionCapacity = 200;
+
+#ifdef PROFILER_HOST
+#define CHECK(condition) if (!(condition)) { printf("Failed: %s\n", #condition); return 1; }
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        printf("Usage: %s <writer>\n", argv[0]);
+        return 1;
+    }
+
+    Profiler::SetCapacity({ functionCapacity, 16, 64 });
+    CHECK(Profiler::GetFunctions().size() == 0);
+
+    pid_t writer = fork();
+    if (writer == 0)
+    {
+        execl(argv[1], argv[1], nullptr);
+        _exit(127);
+    }
+
+    int status;
+    CHECK(waitpid(writer, &status, 0) == writer);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    Profiler::Function* zone = Profiler::GetFunction("Zone");
+    CHECK(zone);
+    CHECK(zone->GetType() == Profiler::Time);
+    CHECK(zone->GetInvocations() == zonesPerFrame);
+    CHECK(zone->GetSamples().GetTotalSampleCount() == frameCount);
+
+    Profiler::Function* value = Profiler::GetFunction("Value");
+    CHECK(value);
+    CHECK(value->GetType() == Profiler::Count);
+    CHECK(value->GetInvocations() == 1);
+    CHECK(value->GetSamples().GetTotalSampleCount() == frameCount);
+    CHECK(value->GetSamples().GetTotalMin() == 0.0f);
+    CHECK(value->GetSamples().GetTotalMax() == frameCount - 1);
+    CHECK(value->GetSamples().GetCurrent() == frameCount - 1);
+    CHECK(value->GetSamples().GetTotalAverage() == (frameCount - 1) / 2.0f);
+    CHECK(value->GetSamples().GetCapacity() == 16);
+    CHECK(value->GetSamples().Data().size() == frameCount);
+
+    Profiler::RemoveFunction("Zone");
+    CHECK(!Profiler::GetFunction("Zone"));
+    value = Profiler::GetFunction("Value");
+    CHECK(value && value->GetSamples().GetTotalSampleCount() == frameCount);
+
+    for (int i = frameCount; i < 100; i++)
+        value->AddSample(i);
+    CHECK(value->GetSamples().GetCapacity() == 64);
+    CHECK(value->GetSamples().GetCurrent() == 99);
+    value->GetSamples().SetSampleLimit(20);
+    value->AddSample(100);
+    CHECK(value->GetSamples().GetCapacity() == 32);
+    CHECK(value->GetSamples().GetCurrent() == 100);
+
+    while (Profiler::GetFunctions().size() < functionCapacity)
+    {
+        Profiler::Function* function = Profiler::AddFunction(std::to_string(Profiler::GetFunctions().size()).c_str(), Profiler::Count);
+        CHECK(function);
+        function->AddSample(function->GetIndex());
+    }
+    CHECK(!Profiler::AddFunction("Overflow"));
+    for (int i = 1; i < functionCapacity; i += 2)
+        Profiler::RemoveFunction(std::to_string(i).c_str());
+    for (int i = 1; i < functionCapacity; i++)
+    {
+        Profiler::Function* function = Profiler::GetFunction(std::to_string(i).c_str());
+        CHECK(i % 2 == 0 ? function && strcmp(function->GetName(), std::to_string(i).c_str()) == 0 : !function);
+        CHECK(!function || function->GetSamples().GetCurrent() == i);
+    }
+    for (auto&& function : Profiler::GetFunctions())
+        CHECK(&Profiler::GetFunctions()[function.GetIndex()] == &function);
+
+    printf("Passed\n");
+    return 0;
+}
+#else
+int main()
+{
+    Profiler::Function* value = Profiler::AddFunction("Value", Profiler::Count);
+    if (!value)
+        return 1;
+
+    for (int frame = 0; frame < frameCount; frame++)
+    {
+        Profiler::BeginFrame();
+        for (int i = 0; i < zonesPerFrame; i++)
+        {
+            PROFILE_NAMED_FUNCTION("Zone");
+        }
+        value->AddSample(frame);
+        Profiler::EndFrame();
+    }
+    return 0;
+}
+#endif